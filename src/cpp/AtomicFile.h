@@ -0,0 +1,59 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Writes <path>.tmp through a large buffer; commit() flushes, fsyncs and renames it
+// over <path>, so a reader only ever sees the old file or the complete new one.
+class AtomicFile {
+public:
+    AtomicFile(const std::string& path, size_t bufferSize = 1 << 20)
+        : path(path), tmpPath(path + ".tmp"), buffer(bufferSize), committed(false) {
+        ofs.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        ofs.open(tmpPath, std::ios::binary | std::ios::trunc);
+    }
+
+    ~AtomicFile() {
+        if (!committed) {
+            ofs.close();
+            std::remove(tmpPath.c_str());
+        }
+    }
+
+    std::ofstream& stream() { return ofs; }
+    explicit operator bool() const { return ofs.good(); }
+
+    bool commit() {
+        ofs.close();
+        if (ofs.fail() || !syncPath(tmpPath)) return false;
+        if (std::rename(tmpPath.c_str(), path.c_str()) != 0) return false;
+        committed = true;
+        // Persist the rename itself.
+        syncPath(directoryOf(path));
+        return true;
+    }
+
+private:
+    static bool syncPath(const std::string& p) {
+        int fd = ::open(p.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        bool ok = ::fsync(fd) == 0;
+        ::close(fd);
+        return ok;
+    }
+
+    static std::string directoryOf(const std::string& p) {
+        size_t slash = p.find_last_of('/');
+        if (slash == std::string::npos) return ".";
+        return slash == 0 ? "/" : p.substr(0, slash);
+    }
+
+    std::string path;
+    std::string tmpPath;
+    std::vector<char> buffer;
+    std::ofstream ofs;
+    bool committed;
+};
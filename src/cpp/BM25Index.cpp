@@ -1,18 +1,133 @@
 #include "BM25Index.h"
+#include "AtomicFile.h"
 #include <fstream>
 #include <map>
 #include <algorithm>
+#include <climits>
+#include <cstdio>
 
-BM25Index::BM25Index(double k1, double b) : k1(k1), b(b), avgDocLength(0) {}
+static const double PROXIMITY_BOOST = 0.5;
+static const size_t PROXIMITY_RERANK_DEPTH = 100;
+
+void BM25Index::encodePositions(const std::vector<int>& pos, std::vector<uint8_t>& out) {
+    int prev = 0;
+    for (int p : pos) {
+        uint32_t delta = p - prev;
+        prev = p;
+        while (delta >= 0x80) {
+            out.push_back((delta & 0x7F) | 0x80);
+            delta >>= 7;
+        }
+        out.push_back(delta);
+    }
+}
+
+static void decodePositions(const uint8_t* begin, const uint8_t* end, std::vector<int>& out) {
+    out.clear();
+    int prev = 0;
+    uint32_t value = 0;
+    int shift = 0;
+    for (const uint8_t* it = begin; it != end; ++it) {
+        uint8_t byte = *it;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (byte & 0x80) {
+            shift += 7;
+            continue;
+        }
+        prev += value;
+        out.push_back(prev);
+        value = 0;
+        shift = 0;
+    }
+}
+
+void PositionList::append(const std::vector<uint8_t>& encoded) {
+    offsets.push_back(data.size());
+    data.insert(data.end(), encoded.begin(), encoded.end());
+}
+
+void PositionList::insert(size_t slot, const std::vector<uint8_t>& encoded) {
+    if (slot == offsets.size()) {
+        append(encoded);
+        return;
+    }
+    uint32_t at = offsets[slot];
+    data.insert(data.begin() + at, encoded.begin(), encoded.end());
+    offsets.insert(offsets.begin() + slot, at);
+    for (size_t i = slot + 1; i < offsets.size(); ++i) offsets[i] += encoded.size();
+}
+
+void PositionList::decode(size_t slot, std::vector<int>& out) const {
+    size_t end = slot + 1 < offsets.size() ? offsets[slot + 1] : data.size();
+    decodePositions(data.data() + offsets[slot], data.data() + end, out);
+}
+
+// Smallest (max - min) over windows holding one position from every list.
+static int minWindow(const std::vector<std::vector<int>>& lists) {
+    std::vector<size_t> cursor(lists.size(), 0);
+    int best = INT_MAX;
+    while (true) {
+        int lo = INT_MAX, hi = INT_MIN;
+        size_t loList = 0;
+        for (size_t i = 0; i < lists.size(); ++i) {
+            int p = lists[i][cursor[i]];
+            if (p < lo) { lo = p; loList = i; }
+            if (p > hi) hi = p;
+        }
+        best = std::min(best, hi - lo);
+        if (++cursor[loList] >= lists[loList].size()) break;
+    }
+    return best;
+}
+
+static bool hasOrderedPhrase(const std::vector<std::vector<int>>& lists) {
+    for (int start : lists[0]) {
+        bool match = true;
+        for (size_t i = 1; i < lists.size() && match; ++i) {
+            match = std::binary_search(lists[i].begin(), lists[i].end(), start + (int)i);
+        }
+        if (match) return true;
+    }
+    return false;
+}
+
+static std::vector<std::pair<int, int>>::const_iterator findPosting(const std::vector<std::pair<int, int>>& postings, int docId) {
+    auto it = std::lower_bound(postings.begin(), postings.end(), docId, [](const auto& p, int id) {
+        return p.first < id;
+    });
+    return (it != postings.end() && it->first == docId) ? it : postings.end();
+}
+
+BM25Index::BM25Index(double k1, double b) : k1(k1), b(b), avgDocLength(0), positional(false) {}
+
+bool BM25Index::setPositional(bool enabled) {
+    if (enabled != positional && !index.empty()) return false;
+    positional = enabled;
+    return true;
+}
 
 void BM25Index::addDocument(const ProcessedDocument& doc) {
     docLengths[doc.id] = doc.length;
-    std::unordered_map<std::string, int> termFreqs;
-    for (const auto& token : doc.tokens) {
-        termFreqs[token]++;
+    std::unordered_map<std::string, std::vector<int>> termPositions;
+    for (size_t i = 0; i < doc.tokens.size(); ++i) {
+        termPositions[doc.tokens[i]].push_back(i);
     }
-    for (const auto& pair : termFreqs) {
-        index[pair.first].push_back({doc.id, pair.second});
+    for (const auto& pair : termPositions) {
+        auto& postings = index[pair.first];
+        auto it = postings.end();
+        if (!postings.empty() && postings.back().first > doc.id) {
+            it = std::lower_bound(postings.begin(), postings.end(), doc.id, [](const auto& p, int id) {
+                return p.first < id;
+            });
+        }
+        size_t slot = it - postings.begin();
+        postings.insert(it, {doc.id, (int)pair.second.size()});
+
+        if (positional) {
+            std::vector<uint8_t> encoded;
+            encodePositions(pair.second, encoded);
+            positions[pair.first].insert(slot, encoded);
+        }
     }
 }
 
@@ -23,38 +138,170 @@ void BM25Index::finalize() {
     avgDocLength = totalLength / docLengths.size();
 }
 
-std::vector<std::pair<int, double>> BM25Index::search(const std::vector<std::string>& tokens) const {
+size_t BM25Index::documentFrequency(const std::string& term) const {
+    auto it = index.find(term);
+    return it == index.end() ? 0 : it->second.size();
+}
+
+std::vector<std::string> BM25Index::terms() const {
+    std::vector<std::string> vocabulary;
+    vocabulary.reserve(index.size());
+    for (const auto& pair : index) vocabulary.push_back(pair.first);
+    return vocabulary;
+}
+
+bool BM25Index::positionsFor(const std::string& term, int docId, std::vector<int>& out) const {
+    auto it = index.find(term);
+    if (it == index.end()) return false;
+    auto posting = findPosting(it->second, docId);
+    if (posting == it->second.end()) return false;
+    positions.at(term).decode(posting - it->second.begin(), out);
+    return true;
+}
+
+std::unordered_map<int, double> BM25Index::matchPhrase(const PhraseQuery& phrase, BM25SearchStats* stats) const {
+    std::unordered_map<int, double> matches;
+
+    std::vector<std::string> terms = phrase.terms;
+    if (phrase.slop >= 0) {
+        std::sort(terms.begin(), terms.end());
+        terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    }
+
+    std::vector<const std::vector<std::pair<int, int>>*> lists;
+    for (const auto& term : terms) {
+        auto it = index.find(term);
+        if (it == index.end()) return matches;
+        lists.push_back(&it->second);
+    }
+
+    // Drive the intersection from the rarest term.
+    size_t rarest = 0;
+    for (size_t i = 1; i < lists.size(); ++i) {
+        if (lists[i]->size() < lists[rarest]->size()) rarest = i;
+    }
+    if (stats) stats->postingsTouched += lists[rarest]->size();
+
+    std::vector<std::vector<int>> termPositions(terms.size());
+    for (const auto& posting : *lists[rarest]) {
+        int docId = posting.first;
+        bool inAll = true;
+        for (size_t i = 0; i < lists.size() && inAll; ++i) {
+            if (i == rarest) continue;
+            inAll = findPosting(*lists[i], docId) != lists[i]->end();
+        }
+        if (!inAll) continue;
+
+        for (size_t i = 0; i < terms.size(); ++i) {
+            positionsFor(terms[i], docId, termPositions[i]);
+        }
+
+        double span;
+        if (phrase.slop < 0) {
+            if (!hasOrderedPhrase(termPositions)) continue;
+            span = terms.size();
+        } else {
+            int width = minWindow(termPositions);
+            if (width - (int)(terms.size() - 1) > phrase.slop) continue;
+            span = width + 1;
+        }
+        matches[docId] = 1.0 + PROXIMITY_BOOST * (terms.size() / span);
+    }
+
+    if (stats) stats->phraseMatches += matches.size();
+    return matches;
+}
+
+std::vector<std::pair<int, double>> BM25Index::search(
+    const std::vector<std::string>& tokens,
+    const std::vector<PhraseQuery>& phrases,
+    const std::vector<WeightedTerm>& expansions,
+    BM25SearchStats* stats
+) const {
     std::map<int, double> docScores;
     size_t N = docLengths.size();
     if (N == 0) return {};
 
-    for (const auto& token : tokens) {
-        auto it = index.find(token);
-        if (it == index.end()) continue;
+    // Phrase constraints act as a filter; each surviving doc carries a proximity factor.
+    bool filtered = positional && !phrases.empty();
+    std::unordered_map<int, double> allowed;
+    for (size_t i = 0; filtered && i < phrases.size(); ++i) {
+        auto matches = matchPhrase(phrases[i], stats);
+        if (i == 0) {
+            allowed = std::move(matches);
+            continue;
+        }
+        for (auto it = allowed.begin(); it != allowed.end();) {
+            auto m = matches.find(it->first);
+            if (m == matches.end()) {
+                it = allowed.erase(it);
+            } else {
+                it->second *= m->second;
+                ++it;
+            }
+        }
+    }
+    if (filtered && allowed.empty()) return {};
+
+    auto scoreTerm = [&](const std::string& term, double weight) {
+        auto it = index.find(term);
+        if (it == index.end()) return;
 
         const auto& postings = it->second;
+        if (stats) stats->postingsTouched += postings.size();
         double idf = log((N - postings.size() + 0.5) / (postings.size() + 0.5) + 1.0);
 
         for (const auto& posting : postings) {
             int docId = posting.first;
+            if (filtered && allowed.find(docId) == allowed.end()) continue;
             int freq = posting.second;
             double docLen = docLengths.at(docId);
             double score = idf * (freq * (k1 + 1)) / (freq + k1 * (1 - b + b * docLen / avgDocLength));
-            docScores[docId] += score;
+            docScores[docId] += score * weight;
         }
-    }
+    };
+
+    for (const auto& token : tokens) scoreTerm(token, 1.0);
+    for (const auto& expansion : expansions) scoreTerm(expansion.term, expansion.weight);
 
     std::vector<std::pair<int, double>> sortedScores(docScores.begin(), docScores.end());
+    if (filtered) {
+        for (auto& entry : sortedScores) entry.second *= allowed[entry.first];
+    }
     std::sort(sortedScores.begin(), sortedScores.end(), [](const auto& a, const auto& b) {
         return a.second > b.second;
     });
 
+    // Unquoted multi-term queries: reward the top candidates whose terms sit close together.
+    if (positional && !filtered && tokens.size() > 1) {
+        std::vector<std::string> terms = tokens;
+        std::sort(terms.begin(), terms.end());
+        terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+        size_t depth = std::min(sortedScores.size(), PROXIMITY_RERANK_DEPTH);
+        std::vector<std::vector<int>> termPositions;
+        std::vector<int> buffer;
+        for (size_t i = 0; i < depth; ++i) {
+            termPositions.clear();
+            for (const auto& term : terms) {
+                if (positionsFor(term, sortedScores[i].first, buffer)) termPositions.push_back(buffer);
+            }
+            if (termPositions.size() < 2) continue;
+            double span = minWindow(termPositions) + 1;
+            sortedScores[i].second *= 1.0 + PROXIMITY_BOOST * (termPositions.size() / span);
+        }
+        std::sort(sortedScores.begin(), sortedScores.begin() + depth, [](const auto& a, const auto& b) {
+            return a.second > b.second;
+        });
+    }
+
     return sortedScores;
 }
 
-bool BM25Index::save(const std::string& filepath) const {
-    std::ofstream ofs(filepath, std::ios::binary);
-    if (!ofs) return false;
+bool BM25Index::save(const std::string& filepath, std::atomic<size_t>* written) const {
+    AtomicFile file(filepath);
+    if (!file) return false;
+    std::ofstream& ofs = file.stream();
 
     // Save params
     ofs.write(reinterpret_cast<const char*>(&k1), sizeof(k1));
@@ -80,8 +327,22 @@ bool BM25Index::save(const std::string& filepath) const {
         size_t postingsSize = p.second.size();
         ofs.write(reinterpret_cast<const char*>(&postingsSize), sizeof(postingsSize));
         ofs.write(reinterpret_cast<const char*>(p.second.data()), postingsSize * sizeof(std::pair<int, int>));
+        if (written) (*written)++;
     }
-    return true;
+
+    // Save positions (optional trailing section, aligned with postings)
+    uint8_t hasPositions = positional ? 1 : 0;
+    ofs.write(reinterpret_cast<const char*>(&hasPositions), sizeof(hasPositions));
+    if (positional) {
+        for (const auto& p : index) {
+            const auto& termPos = positions.at(p.first);
+            size_t dataSize = termPos.data.size();
+            ofs.write(reinterpret_cast<const char*>(termPos.offsets.data()), termPos.offsets.size() * sizeof(uint32_t));
+            ofs.write(reinterpret_cast<const char*>(&dataSize), sizeof(dataSize));
+            ofs.write(reinterpret_cast<const char*>(termPos.data.data()), dataSize);
+        }
+    }
+    return file.commit();
 }
 
 bool BM25Index::load(const std::string& filepath) {
@@ -96,6 +357,7 @@ bool BM25Index::load(const std::string& filepath) {
     // Load docLengths
     size_t docLengthsSize;
     ifs.read(reinterpret_cast<char*>(&docLengthsSize), sizeof(docLengthsSize));
+    if (!ifs) return false;
     for (size_t i = 0; i < docLengthsSize; ++i) {
         int key; int val;
         ifs.read(reinterpret_cast<char*>(&key), sizeof(key));
@@ -104,8 +366,13 @@ bool BM25Index::load(const std::string& filepath) {
     }
 
     // Load index
+    std::vector<std::string> order;
     size_t indexSize;
     ifs.read(reinterpret_cast<char*>(&indexSize), sizeof(indexSize));
+    if (!ifs) {
+        docLengths.clear();
+        return false;
+    }
     for (size_t i = 0; i < indexSize; ++i) {
         size_t keySize;
         ifs.read(reinterpret_cast<char*>(&keySize), sizeof(keySize));
@@ -116,7 +383,112 @@ bool BM25Index::load(const std::string& filepath) {
         ifs.read(reinterpret_cast<char*>(&postingsSize), sizeof(postingsSize));
         std::vector<std::pair<int, int>> postings(postingsSize);
         ifs.read(reinterpret_cast<char*>(postings.data()), postingsSize * sizeof(std::pair<int, int>));
+        if (!ifs) {
+            index.clear();
+            docLengths.clear();
+            return false;
+        }
         index[key] = postings;
+        order.push_back(key);
+    }
+
+    // Load positions if present; files written before positional support end here.
+    uint8_t hasPositions = 0;
+    if (!ifs.read(reinterpret_cast<char*>(&hasPositions), sizeof(hasPositions))) hasPositions = 0;
+    positional = hasPositions != 0;
+    positions.clear();
+    if (positional) {
+        for (const auto& key : order) {
+            auto& termPos = positions[key];
+            termPos.offsets.resize(index[key].size());
+            ifs.read(reinterpret_cast<char*>(termPos.offsets.data()), termPos.offsets.size() * sizeof(uint32_t));
+            size_t dataSize;
+            if (!ifs.read(reinterpret_cast<char*>(&dataSize), sizeof(dataSize))) break;
+            // Offsets must be ascending and inside the buffer, or decode() would read out of bounds.
+            bool valid = std::is_sorted(termPos.offsets.begin(), termPos.offsets.end()) &&
+                         (termPos.offsets.empty() || termPos.offsets.back() <= dataSize);
+            if (!valid) {
+                ifs.setstate(std::ios::failbit);
+                break;
+            }
+            termPos.data.resize(dataSize);
+            ifs.read(reinterpret_cast<char*>(termPos.data.data()), dataSize);
+        }
+        if (!ifs) {
+            index.clear();
+            docLengths.clear();
+            positions.clear();
+            positional = false;
+            return false;
+        }
+    } else {
+        // Older indexes may hold postings in insertion order.
+        for (auto& p : index) {
+            std::sort(p.second.begin(), p.second.end());
+        }
     }
     return true;
 }
+
+BM25Writer::BM25Writer(const std::string& filepath, const std::unordered_map<int, int>& docLengths,
+                       bool positional, double k1, double b)
+    : ofs(filepath, std::ios::binary), posPath(filepath + ".positions.tmp"), termCount(0), positional(positional) {
+    if (!ofs) return;
+
+    double totalLength = 0;
+    for (const auto& pair : docLengths) totalLength += pair.second;
+    double avgDocLength = docLengths.empty() ? 0 : totalLength / docLengths.size();
+
+    ofs.write(reinterpret_cast<const char*>(&k1), sizeof(k1));
+    ofs.write(reinterpret_cast<const char*>(&b), sizeof(b));
+    ofs.write(reinterpret_cast<const char*>(&avgDocLength), sizeof(avgDocLength));
+
+    size_t docLengthsSize = docLengths.size();
+    ofs.write(reinterpret_cast<const char*>(&docLengthsSize), sizeof(docLengthsSize));
+    for (const auto& p : docLengths) {
+        ofs.write(reinterpret_cast<const char*>(&p.first), sizeof(p.first));
+        ofs.write(reinterpret_cast<const char*>(&p.second), sizeof(p.second));
+    }
+
+    // Term count is patched in close() once known.
+    countOffset = ofs.tellp();
+    ofs.write(reinterpret_cast<const char*>(&termCount), sizeof(termCount));
+
+    if (positional) posOfs.open(posPath, std::ios::binary);
+}
+
+void BM25Writer::addTerm(const std::string& term, const std::vector<std::pair<int, int>>& postings,
+                         const PositionList& termPositions) {
+    size_t keySize = term.size();
+    ofs.write(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+    ofs.write(term.c_str(), keySize);
+
+    size_t postingsSize = postings.size();
+    ofs.write(reinterpret_cast<const char*>(&postingsSize), sizeof(postingsSize));
+    ofs.write(reinterpret_cast<const char*>(postings.data()), postingsSize * sizeof(std::pair<int, int>));
+
+    if (positional) {
+        size_t dataSize = termPositions.data.size();
+        posOfs.write(reinterpret_cast<const char*>(termPositions.offsets.data()), termPositions.offsets.size() * sizeof(uint32_t));
+        posOfs.write(reinterpret_cast<const char*>(&dataSize), sizeof(dataSize));
+        posOfs.write(reinterpret_cast<const char*>(termPositions.data.data()), dataSize);
+    }
+    termCount++;
+}
+
+bool BM25Writer::close() {
+    uint8_t hasPositions = positional ? 1 : 0;
+    ofs.write(reinterpret_cast<const char*>(&hasPositions), sizeof(hasPositions));
+    if (positional) {
+        posOfs.close();
+        std::ifstream posIfs(posPath, std::ios::binary);
+        if (termCount > 0) ofs << posIfs.rdbuf();
+        posIfs.close();
+        std::remove(posPath.c_str());
+    }
+
+    ofs.seekp(countOffset);
+    ofs.write(reinterpret_cast<const char*>(&termCount), sizeof(termCount));
+    ofs.close();
+    return !ofs.fail();
+}
@@ -2,19 +2,80 @@
 #include "common.h"
 #include <unordered_map>
 #include <vector>
+#include <cstdint>
+#include <atomic>
+#include <fstream>
+
+// Varint delta-encoded token positions for every posting of one term, packed into
+// a single buffer. offsets[i] is where posting i's bytes start; it ends where the
+// next posting starts (or at the end of data).
+struct PositionList {
+    std::vector<uint32_t> offsets;
+    std::vector<uint8_t> data;
+
+    void append(const std::vector<uint8_t>& encoded);
+    void insert(size_t slot, const std::vector<uint8_t>& encoded);
+    void decode(size_t slot, std::vector<int>& out) const;
+};
+
+struct BM25SearchStats {
+    size_t postingsTouched = 0;
+    size_t phraseMatches = 0;
+};
 
 class BM25Index {
 public:
     BM25Index(double k1 = 1.2, double b = 0.75);
+    bool setPositional(bool enabled);
+    bool isPositional() const { return positional; }
+    size_t termCount() const { return index.size(); }
+    size_t documentFrequency(const std::string& term) const;
+    std::vector<std::string> terms() const;
     void addDocument(const ProcessedDocument& doc);
-    std::vector<std::pair<int, double>> search(const std::vector<std::string>& tokens) const;
+    std::vector<std::pair<int, double>> search(
+        const std::vector<std::string>& tokens,
+        const std::vector<PhraseQuery>& phrases = {},
+        const std::vector<WeightedTerm>& expansions = {},
+        BM25SearchStats* stats = nullptr
+    ) const;
     void finalize();
-    bool save(const std::string& filepath) const;
+    bool save(const std::string& filepath, std::atomic<size_t>* written = nullptr) const;
     bool load(const std::string& filepath);
 
+    static void encodePositions(const std::vector<int>& pos, std::vector<uint8_t>& out);
+
 private:
+    // Returns docId -> proximity factor for every document satisfying the phrase.
+    std::unordered_map<int, double> matchPhrase(const PhraseQuery& phrase, BM25SearchStats* stats) const;
+    bool positionsFor(const std::string& term, int docId, std::vector<int>& out) const;
+
+    // Postings are kept sorted by docId so phrase terms can be intersected.
     std::unordered_map<std::string, std::vector<std::pair<int, int>>> index;
+    // Token positions, aligned with `index` postings.
+    // Stored separately so plain BM25 queries never touch them.
+    std::unordered_map<std::string, PositionList> positions;
     std::unordered_map<int, int> docLengths;
     double k1, b;
     double avgDocLength;
+    bool positional;
+};
+
+// Streams an index.bm25 file one term at a time, in the format BM25Index::load reads,
+// so offline builds never need the whole inverted index in memory.
+class BM25Writer {
+public:
+    BM25Writer(const std::string& filepath, const std::unordered_map<int, int>& docLengths,
+               bool positional, double k1 = 1.2, double b = 0.75);
+    bool ok() const { return ofs.good(); }
+    void addTerm(const std::string& term, const std::vector<std::pair<int, int>>& postings,
+                 const PositionList& termPositions);
+    bool close();
+
+private:
+    std::ofstream ofs;
+    std::ofstream posOfs;
+    std::string posPath;
+    std::streampos countOffset;
+    size_t termCount;
+    bool positional;
 };
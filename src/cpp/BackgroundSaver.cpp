@@ -0,0 +1,121 @@
+#include "BackgroundSaver.h"
+#include "Logger.h"
+#include "json.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <dirent.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+// The child inherits every open socket; holding them would keep clients waiting for EOF.
+static void closeInheritedDescriptors() {
+    std::vector<int> fds;
+    if (DIR* dir = opendir("/proc/self/fd")) {
+        int self = dirfd(dir);
+        while (dirent* entry = readdir(dir)) {
+            int fd = std::atoi(entry->d_name);
+            if (fd > 2 && fd != self) fds.push_back(fd);
+        }
+        closedir(dir);
+    } else {
+        for (int fd = 3; fd < 1024; ++fd) fds.push_back(fd);
+    }
+    for (int fd : fds) close(fd);
+}
+
+BackgroundSaver::BackgroundSaver()
+    : progress(nullptr), running(false), lastOk(false), saves(0), lastDurationMs(0) {
+    void* shared = mmap(nullptr, sizeof(SaveProgress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared != MAP_FAILED) progress = new (shared) SaveProgress();
+}
+
+BackgroundSaver::~BackgroundSaver() {
+    if (progress) {
+        progress->~SaveProgress();
+        munmap(progress, sizeof(SaveProgress));
+    }
+}
+
+BackgroundSaver::StartResult BackgroundSaver::start(HybridSearcher& searcher, const std::string& bm25Path, const std::string& vecPath) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (running) return ALREADY_RUNNING;
+
+    // avgDocLength must be refreshed in the parent too, not just in the snapshot.
+    searcher.finalize();
+    if (progress) {
+        progress->stage = SaveProgress::IDLE;
+        progress->written = 0;
+        progress->total = 0;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        Logger::log(ERROR, "fork() failed for background save");
+        return FAILED;
+    }
+    if (pid == 0) {
+        closeInheritedDescriptors();
+        bool ok = searcher.save(bm25Path, vecPath, progress);
+        _exit(ok ? 0 : 1);
+    }
+
+    running = true;
+    saves++;
+    startedAt = std::chrono::steady_clock::now();
+    std::thread(&BackgroundSaver::reap, this, pid).detach();
+    Logger::log(INFO, "Background save started (pid " + std::to_string(pid) + ")");
+    return STARTED;
+}
+
+void BackgroundSaver::reap(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    double ms;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startedAt).count() / 1000.0;
+        running = false;
+        lastOk = ok;
+        lastDurationMs = ms;
+    }
+    finished.notify_all();
+
+    std::ostringstream oss;
+    oss << "Background save " << (ok ? "completed" : "FAILED") << " in " << ms << " ms";
+    Logger::log(ok ? INFO : ERROR, oss.str());
+}
+
+bool BackgroundSaver::wait() {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    finished.wait(lock, [&] { return !running; });
+    return lastOk;
+}
+
+std::string BackgroundSaver::status() const {
+    static const char* stageNames[] = {"starting", "bm25", "vectors", "docs"};
+
+    std::lock_guard<std::mutex> lock(stateMutex);
+    json j;
+    j["state"] = running ? "running" : (saves == 0 ? "idle" : (lastOk ? "ok" : "failed"));
+    j["saves"] = saves;
+    j["last_duration_ms"] = lastDurationMs;
+
+    if (running) {
+        j["elapsed_ms"] = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startedAt).count();
+        if (progress) {
+            size_t written = progress->written, total = progress->total;
+            j["stage"] = stageNames[progress->stage.load()];
+            j["written"] = written;
+            j["total"] = total;
+            j["progress"] = total ? (double)written / total : 0.0;
+        }
+    }
+    return j.dump();
+}
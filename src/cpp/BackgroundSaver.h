@@ -0,0 +1,36 @@
+#pragma once
+#include "HybridSearcher.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+
+// Redis-style BGSAVE: fork() gives the child a copy-on-write snapshot of the
+// searcher, which it serializes while the parent keeps serving queries.
+class BackgroundSaver {
+public:
+    enum StartResult { STARTED, ALREADY_RUNNING, FAILED };
+
+    BackgroundSaver();
+    ~BackgroundSaver();
+
+    // Caller must hold the searcher lock so the snapshot is consistent.
+    StartResult start(HybridSearcher& searcher, const std::string& bm25Path, const std::string& vecPath);
+    // Blocks until the current save (if any) finishes; returns whether it succeeded.
+    bool wait();
+    std::string status() const;
+
+private:
+    void reap(pid_t pid);
+
+    SaveProgress* progress;
+
+    mutable std::mutex stateMutex;
+    std::condition_variable finished;
+    bool running;
+    bool lastOk;
+    long long saves;
+    double lastDurationMs;
+    std::chrono::steady_clock::time_point startedAt;
+};
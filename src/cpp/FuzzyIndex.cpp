@@ -0,0 +1,105 @@
+#include "FuzzyIndex.h"
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+
+// Optimal string alignment distance (Levenshtein plus adjacent transpositions),
+// abandoned as soon as every cell in a row exceeds `max`.
+static int editDistance(const std::string& a, const std::string& b, int max) {
+    int n = a.size(), m = b.size();
+    if (std::abs(n - m) > max) return max + 1;
+
+    std::vector<int> prev2(m + 1), prev(m + 1), cur(m + 1);
+    for (int j = 0; j <= m; ++j) prev[j] = j;
+
+    for (int i = 1; i <= n; ++i) {
+        cur[0] = i;
+        int rowMin = cur[0];
+        for (int j = 1; j <= m; ++j) {
+            int cost = a[i - 1] == b[j - 1] ? 0 : 1;
+            cur[j] = std::min({prev[j] + 1, cur[j - 1] + 1, prev[j - 1] + cost});
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]) {
+                cur[j] = std::min(cur[j], prev2[j - 2] + 1);
+            }
+            rowMin = std::min(rowMin, cur[j]);
+        }
+        if (rowMin > max) return max + 1;
+        std::swap(prev2, prev);
+        std::swap(prev, cur);
+    }
+    return prev[m];
+}
+
+FuzzyIndex::FuzzyIndex(int maxDistance, size_t prefixLength)
+    : maxDistance(maxDistance), prefixLength(prefixLength) {}
+
+void FuzzyIndex::setMaxDistance(int distance) {
+    if (distance == maxDistance) return;
+    maxDistance = distance;
+
+    // Deletes depend on the distance, so rebuild them for the current vocabulary.
+    std::vector<std::string> existing;
+    existing.swap(terms);
+    termIds.clear();
+    deletes.clear();
+    for (const auto& term : existing) addTerm(term);
+}
+
+void FuzzyIndex::clear() {
+    terms.clear();
+    termIds.clear();
+    deletes.clear();
+}
+
+void FuzzyIndex::generateDeletes(const std::string& word, int distance, std::unordered_set<std::string>& out) const {
+    if (distance == 0 || word.empty()) return;
+    for (size_t i = 0; i < word.size(); ++i) {
+        std::string shorter = word.substr(0, i) + word.substr(i + 1);
+        if (out.insert(shorter).second) generateDeletes(shorter, distance - 1, out);
+    }
+}
+
+void FuzzyIndex::addTerm(const std::string& term) {
+    if (maxDistance <= 0 || termIds.count(term)) return;
+    uint32_t id = terms.size();
+    terms.push_back(term);
+    termIds[term] = id;
+
+    std::unordered_set<std::string> variants;
+    std::string prefix = term.substr(0, prefixLength);
+    variants.insert(prefix);
+    generateDeletes(prefix, maxDistance, variants);
+
+    std::hash<std::string> hasher;
+    for (const auto& variant : variants) {
+        deletes[hasher(variant)].push_back(id);
+    }
+}
+
+std::vector<std::pair<std::string, int>> FuzzyIndex::lookup(const std::string& token, int distance) const {
+    std::vector<std::pair<std::string, int>> matches;
+    distance = std::min(distance, maxDistance);
+    if (distance <= 0 || terms.empty()) return matches;
+
+    std::unordered_set<std::string> variants;
+    std::string prefix = token.substr(0, prefixLength);
+    variants.insert(prefix);
+    generateDeletes(prefix, distance, variants);
+
+    std::hash<std::string> hasher;
+    std::unordered_set<uint32_t> seen;
+    for (const auto& variant : variants) {
+        auto it = deletes.find(hasher(variant));
+        if (it == deletes.end()) continue;
+        for (uint32_t id : it->second) {
+            if (!seen.insert(id).second) continue;
+            int d = editDistance(token, terms[id], distance);
+            if (d <= distance) matches.push_back({terms[id], d});
+        }
+    }
+
+    std::sort(matches.begin(), matches.end(), [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second < b.second : a.first < b.first;
+    });
+    return matches;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// SymSpell-style deletion-neighbourhood index over the BM25 vocabulary.
+// Maps a misspelled token to in-vocabulary terms within a small edit distance
+// without scanning the vocabulary.
+class FuzzyIndex {
+public:
+    FuzzyIndex(int maxDistance = 2, size_t prefixLength = 7);
+    void setMaxDistance(int distance);
+    int getMaxDistance() const { return maxDistance; }
+
+    void addTerm(const std::string& term);
+    bool contains(const std::string& term) const { return termIds.count(term) > 0; }
+    // Returns (term, distance) pairs within `distance` edits (capped at maxDistance), closest first.
+    std::vector<std::pair<std::string, int>> lookup(const std::string& token, int distance) const;
+    size_t size() const { return terms.size(); }
+    void clear();
+
+private:
+    void generateDeletes(const std::string& word, int distance, std::unordered_set<std::string>& out) const;
+
+    int maxDistance;
+    size_t prefixLength;
+    std::vector<std::string> terms;
+    std::unordered_map<std::string, uint32_t> termIds;
+    // Keyed by the hash of each delete; collisions are filtered by the distance check.
+    std::unordered_map<size_t, std::vector<uint32_t>> deletes;
+};
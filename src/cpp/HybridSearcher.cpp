@@ -1,12 +1,14 @@
 #include "HybridSearcher.h"
 #include "Logger.h"
 #include "Telemetry.h"
+#include "AtomicFile.h"
 #include <map>
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
 #include <set>
 #include <fstream>
+#include <cmath>
 
 std::set<std::string> debug_get_ngrams(const std::string& text, int n = 3) {
     std::set<std::string> ngrams;
@@ -17,6 +19,10 @@ std::set<std::string> debug_get_ngrams(const std::string& text, int n = 3) {
     return ngrams;
 }
 
+static const size_t FUZZY_MIN_TOKEN_LENGTH = 3;
+static const size_t FUZZY_MAX_EXPANSIONS = 3;
+static const double FUZZY_DISTANCE_PENALTY = 0.5;
+
 HybridSearcher::HybridSearcher() {}
 
 void HybridSearcher::addDocument(const InputDocument& doc) {
@@ -30,72 +36,175 @@ void HybridSearcher::addDocument(const InputDocument& doc) {
     Logger::log(DEBUG, "Indexing Doc " + std::to_string(doc.id));
 
     bm25Index.addDocument(p_doc);
+    for (const auto& token : p_doc.tokens) fuzzyIndex.addTerm(token);
     std::vector<float> vec = vectorIndex.generateEmbedding(p_doc.tokens);
     vectorIndex.addVector(doc.id, vec);
     Telemetry::instance().updateSystemStats(doc.id, doc.id);
 }
 
-std::string HybridSearcher::getDocumentText(int id) {
-    if (documentCache.find(id) != documentCache.end()) {
-        return documentCache[id];
+void HybridSearcher::setPositional(bool enabled) {
+    if (!bm25Index.setPositional(enabled)) {
+        Logger::log(WARN, "Positional index can only be toggled on an empty index");
+    }
+}
+
+void HybridSearcher::setFuzzyDistance(int distance) {
+    fuzzyIndex.setMaxDistance(distance);
+}
+
+void HybridSearcher::expandTypos(const std::vector<std::string>& tokens, std::vector<WeightedTerm>& expansions) const {
+    for (const auto& token : tokens) {
+        if (token.size() < FUZZY_MIN_TOKEN_LENGTH || fuzzyIndex.contains(token)) continue;
+        if (std::any_of(token.begin(), token.end(), [](char c) { return std::isdigit(c); })) continue;
+
+        // Short tokens only tolerate a single edit; anything looser is mostly noise.
+        int distance = token.size() <= 4 ? 1 : 2;
+        auto candidates = fuzzyIndex.lookup(token, distance);
+        std::stable_sort(candidates.begin(), candidates.end(), [&](const auto& a, const auto& b) {
+            if (a.second != b.second) return a.second < b.second;
+            return bm25Index.documentFrequency(a.first) > bm25Index.documentFrequency(b.first);
+        });
+
+        for (size_t i = 0; i < std::min(candidates.size(), FUZZY_MAX_EXPANSIONS); ++i) {
+            expansions.push_back({candidates[i].first, std::pow(FUZZY_DISTANCE_PENALTY, candidates[i].second)});
+        }
+    }
+}
+
+std::string HybridSearcher::getDocumentText(int id) const {
+    auto it = documentCache.find(id);
+    if (it != documentCache.end()) {
+        return it->second;
     }
     return "[Text not found in cache]";
 }
 
-std::vector<int> HybridSearcher::search(const std::string& query, int topK) {
-    auto start = std::chrono::high_resolution_clock::now();
+std::vector<int> HybridSearcher::search(const std::string& query, int topK, QueryProfile* profile) {
+    auto start = std::chrono::steady_clock::now();
+    QueryProfile prof;
 
     std::vector<std::string> tokens;
-    tokenize(query, tokens);
+    std::vector<PhraseQuery> phrases;
     std::vector<std::string> breakdown_ngrams;
-    for(const auto& t : tokens) {
-        auto grams = debug_get_ngrams(t, 3);
-        breakdown_ngrams.insert(breakdown_ngrams.end(), grams.begin(), grams.end());
+    {
+        StageTimer st(prof.tokenizeMs);
+        parseQuery(query, tokens, phrases);
+        for(const auto& t : tokens) {
+            auto grams = debug_get_ngrams(t, 3);
+            breakdown_ngrams.insert(breakdown_ngrams.end(), grams.begin(), grams.end());
+        }
+    }
+    prof.tokens = tokens.size();
+
+    std::vector<WeightedTerm> expansions;
+    {
+        StageTimer st(prof.fuzzyMs);
+        expandTypos(tokens, expansions);
+    }
+    prof.fuzzyExpansions = expansions.size();
+
+    std::vector<std::pair<int, double>> bm25_results;
+    BM25SearchStats bm25Stats;
+    {
+        StageTimer st(prof.bm25Ms);
+        bm25_results = bm25Index.search(tokens, phrases, expansions, &bm25Stats);
+    }
+    prof.postingsTouched = bm25Stats.postingsTouched;
+    prof.phraseMatches = bm25Stats.phraseMatches;
+    bool phraseFiltered = bm25Index.isPositional() && !phrases.empty();
+
+    std::vector<float> query_vec;
+    {
+        StageTimer st(prof.embedMs);
+        query_vec = vectorIndex.generateEmbedding(tokens);
     }
 
-    auto bm25_results = bm25Index.search(tokens);
-    std::vector<float> query_vec = vectorIndex.generateEmbedding(tokens);
-    auto vec_results = vectorIndex.search(query_vec, topK);
+    std::vector<std::pair<int, double>> vec_results;
+    {
+        StageTimer st(prof.vectorMs);
+        vec_results = vectorIndex.search(query_vec, topK);
+    }
+    if (phraseFiltered) {
+        // Phrases are hard constraints: the vector leg may only rerank phrase matches.
+        std::set<int> allowed;
+        for (const auto& res : bm25_results) allowed.insert(res.first);
+        vec_results.erase(std::remove_if(vec_results.begin(), vec_results.end(), [&](const auto& res) {
+            return allowed.count(res.first) == 0;
+        }), vec_results.end());
+    }
+    prof.vectorsScanned = vectorIndex.size();
+    prof.bm25Candidates = bm25_results.size();
+    prof.vectorCandidates = vec_results.size();
 
-    std::map<int, double> final_scores;
-    double bm25Weight = bm25_results.empty() ? 0.0 : 0.7;
-    double vectorWeight = bm25_results.empty() ? 1.0 : 0.3;
+    std::vector<std::pair<int, double>> sorted_final;
+    {
+        StageTimer st(prof.fusionMs);
+        std::map<int, double> final_scores;
+        double bm25Weight = bm25_results.empty() ? 0.0 : 0.7;
+        double vectorWeight = bm25_results.empty() ? 1.0 : 0.3;
 
-    for(const auto& res : bm25_results) final_scores[res.first] += res.second * bm25Weight;
-    for(const auto& res : vec_results) final_scores[res.first] += res.second * vectorWeight;
+        for(const auto& res : bm25_results) final_scores[res.first] += res.second * bm25Weight;
+        for(const auto& res : vec_results) final_scores[res.first] += res.second * vectorWeight;
 
-    std::vector<std::pair<int, double>> sorted_final(final_scores.begin(), final_scores.end());
-    std::sort(sorted_final.begin(), sorted_final.end(), [](const auto& a, const auto& b) {
-        return a.second > b.second;
-    });
+        sorted_final.assign(final_scores.begin(), final_scores.end());
+        std::sort(sorted_final.begin(), sorted_final.end(), [](const auto& a, const auto& b) {
+            return a.second > b.second;
+        });
+    }
+    prof.fusedCandidates = sorted_final.size();
 
     std::vector<std::tuple<int, double, std::string>> rich_results;
     std::vector<int> final_ids;
+    {
+        StageTimer st(prof.hydrateMs);
+        for (int i = 0; i < std::min((int)sorted_final.size(), topK); ++i) {
+            int id = sorted_final[i].first;
+            double score = sorted_final[i].second;
+            final_ids.push_back(id);
 
-    for (int i = 0; i < std::min((int)sorted_final.size(), topK); ++i) {
-        int id = sorted_final[i].first;
-        double score = sorted_final[i].second;
-        final_ids.push_back(id);
-
-        rich_results.push_back({id, score, getDocumentText(id)});
+            rich_results.push_back({id, score, getDocumentText(id)});
+        }
     }
+    prof.returned = final_ids.size();
 
-    auto end = std::chrono::high_resolution_clock::now();
+    auto end = std::chrono::steady_clock::now();
     double duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
 
-    Telemetry::instance().recordQuery(query, tokens, breakdown_ngrams, rich_results, duration);
+    {
+        StageTimer st(prof.telemetryMs);
+        Telemetry::instance().recordQuery(query, tokens, breakdown_ngrams, rich_results, duration);
+    }
+    prof.totalMs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+
+    Telemetry::instance().recordProfile(query, prof);
+    if (profile) *profile = prof;
 
     return final_ids;
 }
 
-bool HybridSearcher::save(const std::string& bm25Path, const std::string& vecPath) {
+void HybridSearcher::finalize() {
     bm25Index.finalize();
+}
+
+// Does not log: it also runs inside the forked background-save child.
+bool HybridSearcher::save(const std::string& bm25Path, const std::string& vecPath, SaveProgress* progress) {
+    finalize();
 
-    bool indexSaved = bm25Index.save(bm25Path) && vectorIndex.save(vecPath);
-    if (!indexSaved) return false;
+    std::atomic<size_t>* written = nullptr;
+    if (progress) {
+        progress->total = bm25Index.termCount() + vectorIndex.size() + documentCache.size();
+        written = &progress->written;
+        progress->stage = SaveProgress::BM25;
+    }
+    if (!bm25Index.save(bm25Path, written)) return false;
+
+    if (progress) progress->stage = SaveProgress::VECTORS;
+    if (!vectorIndex.save(vecPath, written)) return false;
 
-    std::ofstream docFile("index.docs", std::ios::binary);
-    if (!docFile) return false;
+    if (progress) progress->stage = SaveProgress::DOCS;
+    AtomicFile file("index.docs");
+    if (!file) return false;
+    std::ofstream& docFile = file.stream();
 
     size_t cacheSize = documentCache.size();
     docFile.write(reinterpret_cast<const char*>(&cacheSize), sizeof(cacheSize));
@@ -106,16 +215,26 @@ bool HybridSearcher::save(const std::string& bm25Path, const std::string& vecPat
         docFile.write(reinterpret_cast<const char*>(&id), sizeof(id));
         docFile.write(reinterpret_cast<const char*>(&len), sizeof(len));
         docFile.write(pair.second.c_str(), len);
+        if (written) (*written)++;
     }
 
-    Logger::log(INFO, "Saved " + std::to_string(cacheSize) + " documents to index.docs");
-    return true;
+    return file.commit();
 }
 
 bool HybridSearcher::load(const std::string& bm25Path, const std::string& vecPath) {
+    bool positional = bm25Index.isPositional();
     if (!bm25Index.load(bm25Path) || !vectorIndex.load(vecPath)) {
+        // Never serve a half-read index.
+        bm25Index = BM25Index();
+        bm25Index.setPositional(positional);
+        vectorIndex = VectorIndex();
         return false;
     }
+    Logger::log(INFO, std::string("Positional postings ") + (bm25Index.isPositional() ? "enabled" : "disabled"));
+
+    fuzzyIndex.clear();
+    for (const auto& term : bm25Index.terms()) fuzzyIndex.addTerm(term);
+    Logger::log(INFO, "Fuzzy index built over " + std::to_string(fuzzyIndex.size()) + " terms");
 
     std::ifstream docFile("index.docs", std::ios::binary);
     if (docFile) {
@@ -130,6 +249,7 @@ bool HybridSearcher::load(const std::string& bm25Path, const std::string& vecPat
 
             std::string text(len, ' ');
             docFile.read(&text[0], len);
+            if (!docFile) break;
 
             documentCache[id] = text;
         }
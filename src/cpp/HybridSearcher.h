@@ -1,20 +1,38 @@
 #pragma once
 #include "BM25Index.h"
 #include "VectorIndex.h"
+#include "FuzzyIndex.h"
+#include "Telemetry.h"
 #include <unordered_map>
+#include <atomic>
+
+// Lives in memory shared with the background-save child, so it holds only lock-free atomics.
+struct SaveProgress {
+    enum Stage { IDLE, BM25, VECTORS, DOCS };
+    std::atomic<int> stage{IDLE};
+    std::atomic<size_t> written{0};
+    std::atomic<size_t> total{0};
+};
 
 class HybridSearcher {
 public:
     HybridSearcher();
+    void setPositional(bool enabled);
+    void setFuzzyDistance(int distance);
     void addDocument(const InputDocument& doc);
-    std::vector<int> search(const std::string& query, int topK);
-    bool save(const std::string& bm25Path, const std::string& vecPath);
+    std::vector<int> search(const std::string& query, int topK, QueryProfile* profile = nullptr);
+    void finalize();
+    bool save(const std::string& bm25Path, const std::string& vecPath, SaveProgress* progress = nullptr);
     bool load(const std::string& bm25Path, const std::string& vecPath);
 
-    std::string getDocumentText(int id);
+    // Read-only, so concurrent searches may call it under a shared lock.
+    std::string getDocumentText(int id) const;
 
 private:
+    void expandTypos(const std::vector<std::string>& tokens, std::vector<WeightedTerm>& expansions) const;
+
     BM25Index bm25Index;
+    FuzzyIndex fuzzyIndex;
     VectorIndex vectorIndex;
     std::unordered_map<int, std::string> documentCache;
 };
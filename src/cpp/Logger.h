@@ -60,3 +60,14 @@ public:
         Logger::log(PERF, oss.str());
     }
 };
+
+class StageTimer {
+    double& out;
+    std::chrono::steady_clock::time_point start;
+public:
+    StageTimer(double& target) : out(target), start(std::chrono::steady_clock::now()) {}
+    ~StageTimer() {
+        auto end = std::chrono::steady_clock::now();
+        out += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e6;
+    }
+};
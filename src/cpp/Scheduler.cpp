@@ -0,0 +1,136 @@
+#include "Scheduler.h"
+#include "json.hpp"
+#include <sys/socket.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+void sendResponse(int socket, const std::string& response) {
+    send(socket, response.c_str(), response.length(), 0);
+    close(socket);
+}
+
+Scheduler::Scheduler(Handler handler, const SchedulerConfig& config)
+    : handler(std::move(handler)), config(config), writeActive(false), stopping(false) {}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    readReady.notify_all();
+    writeReady.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+void Scheduler::start() {
+    for (int i = 0; i < config.readWorkers; ++i) {
+        threads.emplace_back(&Scheduler::readLoop, this);
+    }
+    threads.emplace_back(&Scheduler::writeLoop, this);
+}
+
+bool Scheduler::submit(Job&& job, Lane lane, std::string& rejection) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto& queue = lane == READ ? readQueue : writeQueue;
+    size_t capacity = lane == READ ? config.readCapacity : config.writeCapacity;
+
+    if (stopping || queue.size() >= capacity) {
+        (lane == READ ? readStats : writeStats).shed++;
+        rejection = json({
+            {"error", "overloaded"},
+            {"lane", lane == READ ? "search" : "write"},
+            {"queue_depth", queue.size()}
+        }).dump();
+        return false;
+    }
+
+    job.enqueuedAt = SchedulerClock::now();
+    queue.push_back(std::move(job));
+    (lane == READ ? readReady : writeReady).notify_one();
+    return true;
+}
+
+void Scheduler::readLoop() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            readReady.wait(lock, [&] { return stopping || (!readQueue.empty() && !writeActive); });
+            if (stopping) return;
+            job = std::move(readQueue.front());
+            readQueue.pop_front();
+            readStats.inFlight++;
+            if (readQueue.empty()) writeReady.notify_one();
+        }
+        run(job, readStats);
+    }
+}
+
+void Scheduler::writeLoop() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            writeReady.wait(lock, [&] { return stopping || !writeQueue.empty(); });
+            if (stopping) return;
+
+            // Let queued searches drain first, but never defer a write indefinitely.
+            auto deferUntil = writeQueue.front().enqueuedAt + config.maxWriteDefer;
+            writeReady.wait_until(lock, deferUntil, [&] { return stopping || readQueue.empty(); });
+            if (stopping) return;
+
+            writeActive = true;
+            job = std::move(writeQueue.front());
+            writeQueue.pop_front();
+            writeStats.inFlight++;
+        }
+        run(job, writeStats);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            writeActive = false;
+        }
+        readReady.notify_all();
+    }
+}
+
+void Scheduler::run(Job& job, LaneStats& laneStats) {
+    double waitMs = std::chrono::duration_cast<std::chrono::microseconds>(SchedulerClock::now() - job.enqueuedAt).count() / 1000.0;
+
+    job.timedOut = job.expired();
+    std::string response = job.timedOut ? "{\"error\":\"deadline exceeded\"}" : handler(job);
+
+    // Account before replying so a STATS sent right after sees this job.
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        laneStats.inFlight--;
+        if (job.timedOut) laneStats.expired++;
+        else laneStats.completed++;
+        laneStats.totalWaitMs += waitMs;
+        laneStats.maxWaitMs = std::max(laneStats.maxWaitMs, waitMs);
+    }
+    if (!response.empty()) sendResponse(job.socket, response);
+}
+
+std::string Scheduler::stats() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto laneJson = [](const LaneStats& s, size_t depth, size_t capacity) {
+        long long handled = s.completed + s.expired;
+        return json{
+            {"queue_depth", depth},
+            {"capacity", capacity},
+            {"in_flight", s.inFlight},
+            {"completed", s.completed},
+            {"shed", s.shed},
+            {"expired", s.expired},
+            {"avg_wait_ms", handled ? s.totalWaitMs / handled : 0.0},
+            {"max_wait_ms", s.maxWaitMs}
+        };
+    };
+
+    json j;
+    j["search"] = laneJson(readStats, readQueue.size(), config.readCapacity);
+    j["write"] = laneJson(writeStats, writeQueue.size(), config.writeCapacity);
+    j["search"]["workers"] = config.readWorkers;
+    return j.dump();
+}
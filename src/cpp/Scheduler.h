@@ -0,0 +1,79 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using SchedulerClock = std::chrono::steady_clock;
+
+struct Job {
+    int socket;
+    std::string command;
+    std::string payload;
+    SchedulerClock::time_point enqueuedAt;
+    SchedulerClock::time_point deadline;
+    bool hasDeadline = false;
+    // Set when the job is dropped for its deadline, including by the handler
+    // after waiting on a lock, so the lane counts it as expired.
+    bool timedOut = false;
+
+    bool expired() const { return hasDeadline && SchedulerClock::now() > deadline; }
+};
+
+struct SchedulerConfig {
+    int readWorkers = std::max(1u, std::thread::hardware_concurrency());
+    size_t readCapacity = 256;
+    size_t writeCapacity = 1024;
+    // Longest a queued write waits for searches to drain before it goes anyway.
+    std::chrono::milliseconds maxWriteDefer{20};
+};
+
+void sendResponse(int socket, const std::string& response);
+
+// Bounded two-lane scheduler: a pool of read workers for SEARCH and a single
+// writer for INDEX/SAVE. Searches run first; a write only waits up to
+// maxWriteDefer, then new searches hold back until it has finished.
+class Scheduler {
+public:
+    enum Lane { READ, WRITE };
+    // An empty response means the handler took over the socket and replies itself.
+    using Handler = std::function<std::string(Job&)>;
+
+    Scheduler(Handler handler, const SchedulerConfig& config);
+    ~Scheduler();
+
+    void start();
+    // Queues the job, or returns false with a load-shedding response when the lane is full.
+    bool submit(Job&& job, Lane lane, std::string& rejection);
+    std::string stats() const;
+
+private:
+    struct LaneStats {
+        long long completed = 0;
+        long long shed = 0;
+        long long expired = 0;
+        long long inFlight = 0;
+        double totalWaitMs = 0;
+        double maxWaitMs = 0;
+    };
+
+    void readLoop();
+    void writeLoop();
+    void run(Job& job, LaneStats& laneStats);
+
+    Handler handler;
+    SchedulerConfig config;
+
+    mutable std::mutex mtx;
+    std::condition_variable readReady, writeReady;
+    std::deque<Job> readQueue, writeQueue;
+    bool writeActive;
+    bool stopping;
+    LaneStats readStats, writeStats;
+    std::vector<std::thread> threads;
+};
@@ -64,6 +64,57 @@ void Telemetry::updateSystemStats(size_t docs, size_t vecs) {
 //    writeDashboardData();
 }
 
+static json profileToJson(const QueryProfile& p) {
+    json j;
+    j["total_ms"] = p.totalMs;
+    j["stages_ms"] = {
+        {"tokenize", p.tokenizeMs},
+        {"fuzzy", p.fuzzyMs},
+        {"bm25", p.bm25Ms},
+        {"embed", p.embedMs},
+        {"vector", p.vectorMs},
+        {"fusion", p.fusionMs},
+        {"hydrate", p.hydrateMs},
+        {"telemetry", p.telemetryMs}
+    };
+    j["counters"] = {
+        {"tokens", p.tokens},
+        {"fuzzy_expansions", p.fuzzyExpansions},
+        {"postings_touched", p.postingsTouched},
+        {"phrase_matches", p.phraseMatches},
+        {"vectors_scanned", p.vectorsScanned},
+        {"bm25_candidates", p.bm25Candidates},
+        {"vector_candidates", p.vectorCandidates},
+        {"fused_candidates", p.fusedCandidates},
+        {"returned", p.returned}
+    };
+    return j;
+}
+
+std::string Telemetry::explain(const QueryProfile& profile) const {
+    return profileToJson(profile).dump();
+}
+
+void Telemetry::configureSlowLog(double thresholdMs, int sampleEvery, const std::string& path) {
+    std::lock_guard<std::mutex> lock(slowMutex);
+    slowThresholdMs = thresholdMs;
+    slowSampleEvery = sampleEvery < 1 ? 1 : sampleEvery;
+    slowLogPath = path;
+}
+
+void Telemetry::recordProfile(const std::string& query, const QueryProfile& profile) {
+    std::lock_guard<std::mutex> lock(slowMutex);
+    if (slowThresholdMs <= 0 || profile.totalMs < slowThresholdMs) return;
+    if (slowSeen++ % slowSampleEvery != 0) return;
+
+    json j = profileToJson(profile);
+    j["timestamp"] = getCurrentTime();
+    j["query"] = query;
+
+    std::ofstream ofs(slowLogPath, std::ios::app);
+    ofs << j.dump() << "\n";
+}
+
 void Telemetry::writeDashboardData() {
 //    json j;
 //
@@ -14,6 +14,30 @@ struct QueryStat {
     std::vector<std::pair<int, double>> topResults;
 };
 
+struct QueryProfile {
+    // Stage timings (ms)
+    double tokenizeMs = 0;
+    double fuzzyMs = 0;
+    double bm25Ms = 0;
+    double embedMs = 0;
+    double vectorMs = 0;
+    double fusionMs = 0;
+    double hydrateMs = 0;
+    double telemetryMs = 0;
+    double totalMs = 0;
+
+    // Work counters
+    size_t tokens = 0;
+    size_t fuzzyExpansions = 0;
+    size_t postingsTouched = 0;
+    size_t phraseMatches = 0;
+    size_t vectorsScanned = 0;
+    size_t bm25Candidates = 0;
+    size_t vectorCandidates = 0;
+    size_t fusedCandidates = 0;
+    size_t returned = 0;
+};
+
 class Telemetry {
 public:
     static Telemetry& instance() {
@@ -31,8 +55,13 @@ public:
 
     void updateSystemStats(size_t docs, size_t vecs);
 
+    void configureSlowLog(double thresholdMs, int sampleEvery, const std::string& path);
+    void recordProfile(const std::string& query, const QueryProfile& profile);
+    std::string explain(const QueryProfile& profile) const;
+
 private:
-    Telemetry() : totalQueries(0), docsIndexed(0), vectorNodes(0) {}
+    Telemetry() : totalQueries(0), docsIndexed(0), vectorNodes(0),
+                  slowThresholdMs(100.0), slowSampleEvery(1), slowSeen(0), slowLogPath("slow_queries.log") {}
 
     void writeDashboardData();
     std::string getCurrentTime();
@@ -43,4 +72,10 @@ private:
 
     size_t docsIndexed;
     size_t vectorNodes;
+
+    std::mutex slowMutex;
+    double slowThresholdMs;
+    int slowSampleEvery;
+    long long slowSeen;
+    std::string slowLogPath;
 };
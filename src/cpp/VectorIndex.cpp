@@ -1,5 +1,6 @@
 #include "VectorIndex.h"
 #include "Logger.h"
+#include "AtomicFile.h"
 #include <fstream>
 #include <algorithm>
 #include <vector>
@@ -68,17 +69,19 @@ std::vector<std::pair<int, double>> VectorIndex::search(const std::vector<float>
     return allScores;
 }
 
-bool VectorIndex::save(const std::string& filepath) const {
-    std::ofstream ofs(filepath, std::ios::binary);
-    if (!ofs) return false;
+bool VectorIndex::save(const std::string& filepath, std::atomic<size_t>* written) const {
+    AtomicFile file(filepath);
+    if (!file) return false;
+    std::ofstream& ofs = file.stream();
     size_t totalSize = vectors.size();
     ofs.write(reinterpret_cast<const char*>(&totalSize), sizeof(totalSize));
     for (const auto& p : vectors) {
         ofs.write(reinterpret_cast<const char*>(&p.first), sizeof(p.first));
         size_t dim = p.second.size();
         ofs.write(reinterpret_cast<const char*>(p.second.data()), dim * sizeof(float));
+        if (written) (*written)++;
     }
-    return true;
+    return file.commit();
 }
 
 bool VectorIndex::load(const std::string& filepath) {
@@ -86,11 +89,16 @@ bool VectorIndex::load(const std::string& filepath) {
     if (!ifs) return false;
     size_t totalSize;
     ifs.read(reinterpret_cast<char*>(&totalSize), sizeof(totalSize));
+    if (!ifs) return false;
     for (size_t i = 0; i < totalSize; ++i) {
         int docId;
         std::vector<float> vec(1024);
         ifs.read(reinterpret_cast<char*>(&docId), sizeof(docId));
         ifs.read(reinterpret_cast<char*>(vec.data()), 1024 * sizeof(float));
+        if (!ifs) {
+            vectors.clear();
+            return false;
+        }
         vectors[docId] = vec;
     }
     return true;
@@ -2,14 +2,16 @@
 #include "common.h"
 #include <unordered_map>
 #include <vector>
+#include <atomic>
 
 class VectorIndex {
 public:
     std::vector<float> generateEmbedding(const std::vector<std::string>& tokens) const;
     void addVector(int docId, const std::vector<float>& vec);
     std::vector<std::pair<int, double>> search(const std::vector<float>& queryVec, int k) const;
-    bool save(const std::string& filepath) const;
+    bool save(const std::string& filepath, std::atomic<size_t>* written = nullptr) const;
     bool load(const std::string& filepath);
+    size_t size() const { return vectors.size(); }
 
 private:
     std::unordered_map<int, std::vector<float>> vectors;
@@ -6,6 +6,7 @@
 #include <cmath>
 
 const int VECTOR_DIMENSION = 1024;
+const int MAX_PHRASE_SLOP = 100000;
 
 struct InputDocument {
     int id;
@@ -33,6 +34,56 @@ inline void tokenize(const std::string& text, std::vector<std::string>& tokens)
     }
 }
 
+// A query term scored at a fraction of its BM25 weight (e.g. a typo correction).
+struct WeightedTerm {
+    std::string term;
+    double weight;
+};
+
+// A quoted query segment. slop < 0 means an exact, ordered phrase;
+// slop >= 0 allows up to `slop` other words between the terms, in any order.
+struct PhraseQuery {
+    std::vector<std::string> terms;
+    int slop = -1;
+};
+
+// Splits a raw query into plain tokens and phrase constraints.
+// Supports "exact phrase" and "proximity terms"~N.
+inline void parseQuery(const std::string& query, std::vector<std::string>& tokens, std::vector<PhraseQuery>& phrases) {
+    std::string plain;
+    size_t i = 0;
+    while (i < query.size()) {
+        if (query[i] != '"') {
+            plain += query[i++];
+            continue;
+        }
+        size_t close = query.find('"', i + 1);
+        if (close == std::string::npos) {
+            plain += query.substr(i + 1);
+            break;
+        }
+        std::string segment = query.substr(i + 1, close - i - 1);
+        plain += ' ' + segment + ' ';
+        i = close + 1;
+
+        PhraseQuery phrase;
+        tokenize(segment, phrase.terms);
+        if (i < query.size() && query[i] == '~') {
+            // Clamp instead of overflowing; a slop this large already spans any realistic document.
+            size_t digits = i + 1;
+            int slop = 0;
+            while (digits < query.size() && std::isdigit((unsigned char)query[digits])) {
+                slop = std::min(slop * 10 + (query[digits] - '0'), MAX_PHRASE_SLOP);
+                digits++;
+            }
+            if (digits > i + 1) phrase.slop = slop;
+            i = digits;
+        }
+        if (phrase.terms.size() > 1) phrases.push_back(phrase);
+    }
+    tokenize(plain, tokens);
+}
+
 inline double cosine_similarity(const std::vector<float>& a, const std::vector<float>& b) {
     double dot_product = 0.0, norm_a = 0.0, norm_b = 0.0;
     for (size_t i = 0; i < a.size(); ++i) {
@@ -0,0 +1,556 @@
+#include "BM25Index.h"
+#include "VectorIndex.h"
+#include "Logger.h"
+#include "json.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+
+using json = nlohmann::json;
+
+// Offline builder: reads a JSONL corpus ({"id": ..., "text": ...} per line) and writes
+// index.bm25 / index.vec / index.docs exactly as the daemon's SAVE would.
+
+struct IndexerConfig {
+    std::string corpusPath;
+    std::string outDir = ".";
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t memBudget = 1024ull * 1024 * 1024;
+    size_t batchSize = 4096;
+    // Most spilled runs merged (and held open) at once; lowered to fit RLIMIT_NOFILE.
+    size_t mergeFanIn = 64;
+    bool positional = false;
+};
+
+struct PostingRecord {
+    std::string term;
+    int docId;
+    int freq;
+    std::vector<uint8_t> positions;
+
+    bool operator<(const PostingRecord& other) const {
+        return term != other.term ? term < other.term : docId < other.docId;
+    }
+    size_t footprint() const {
+        return sizeof(PostingRecord) + term.capacity() + positions.capacity();
+    }
+};
+
+// A sorted run of posting records, either still in memory or spilled to disk.
+class Run {
+public:
+    virtual ~Run() = default;
+    virtual bool open() { return true; }
+    virtual bool next(PostingRecord& rec) = 0;
+    // True once next() stopped because of an error rather than the end of the run.
+    virtual bool failed() const { return false; }
+};
+
+class MemoryRun : public Run {
+public:
+    MemoryRun(std::vector<PostingRecord>&& recs) : records(std::move(recs)), cursor(0) {}
+    bool next(PostingRecord& rec) override {
+        if (cursor >= records.size()) return false;
+        rec = std::move(records[cursor++]);
+        return true;
+    }
+
+private:
+    std::vector<PostingRecord> records;
+    size_t cursor;
+};
+
+// Spilled runs are opened only when a merge starts, so file descriptors are held
+// by one merge's worth of runs rather than by every run spilled so far.
+class FileRun : public Run {
+public:
+    FileRun(const std::string& path) : path(path), error(false) {}
+    ~FileRun() override {
+        ifs.close();
+        std::remove(path.c_str());
+    }
+    bool open() override {
+        ifs.open(path, std::ios::binary);
+        if (!ifs.is_open()) fail("Cannot open spilled run ");
+        return !error;
+    }
+    bool next(PostingRecord& rec) override {
+        if (error || !ifs.is_open()) return false;
+        uint32_t termLen;
+        if (!ifs.read(reinterpret_cast<char*>(&termLen), sizeof(termLen))) {
+            // A clean end of file stops exactly on a record boundary.
+            if (ifs.gcount() != 0 || !ifs.eof()) fail("Truncated spilled run ");
+            return false;
+        }
+        rec.term.resize(termLen);
+        ifs.read(&rec.term[0], termLen);
+        ifs.read(reinterpret_cast<char*>(&rec.docId), sizeof(rec.docId));
+        ifs.read(reinterpret_cast<char*>(&rec.freq), sizeof(rec.freq));
+        uint32_t posLen;
+        ifs.read(reinterpret_cast<char*>(&posLen), sizeof(posLen));
+        rec.positions.resize(posLen);
+        ifs.read(reinterpret_cast<char*>(rec.positions.data()), posLen);
+        if (ifs.fail()) {
+            fail("Truncated spilled run ");
+            return false;
+        }
+        return true;
+    }
+    bool failed() const override { return error; }
+
+    static void writeRecord(std::ofstream& ofs, const PostingRecord& rec) {
+        uint32_t termLen = rec.term.size();
+        ofs.write(reinterpret_cast<const char*>(&termLen), sizeof(termLen));
+        ofs.write(rec.term.c_str(), termLen);
+        ofs.write(reinterpret_cast<const char*>(&rec.docId), sizeof(rec.docId));
+        ofs.write(reinterpret_cast<const char*>(&rec.freq), sizeof(rec.freq));
+        uint32_t posLen = rec.positions.size();
+        ofs.write(reinterpret_cast<const char*>(&posLen), sizeof(posLen));
+        ofs.write(reinterpret_cast<const char*>(rec.positions.data()), posLen);
+    }
+
+    static bool write(const std::string& path, const std::vector<PostingRecord>& records) {
+        std::ofstream ofs(path, std::ios::binary);
+        if (!ofs) return false;
+        for (const auto& rec : records) writeRecord(ofs, rec);
+        return !ofs.fail();
+    }
+
+private:
+    void fail(const std::string& what) {
+        Logger::log(ERROR, what + path);
+        error = true;
+    }
+
+    std::string path;
+    std::ifstream ifs;
+    bool error;
+};
+
+// Streams the union of sorted runs in (term, docId) order. The heap holds run
+// indices and each run's current record stays in `heads`, so a pop swaps the
+// record out instead of copying its term and positions.
+class RunMerger {
+public:
+    RunMerger(const std::vector<Run*>& runs) : runs(runs), heads(runs.size()), error(false) {
+        for (size_t i = 0; i < runs.size(); ++i) {
+            if (runs[i]->open()) advance(i);
+            else error = true;
+        }
+    }
+
+    bool next(PostingRecord& rec) {
+        if (heap.empty()) return false;
+        std::pop_heap(heap.begin(), heap.end(), Greater{heads});
+        size_t run = heap.back();
+        heap.pop_back();
+        std::swap(rec, heads[run]);
+        advance(run);
+        return true;
+    }
+
+    bool failed() const { return error; }
+
+private:
+    struct Greater {
+        const std::vector<PostingRecord>& heads;
+        bool operator()(size_t a, size_t b) const { return heads[b] < heads[a]; }
+    };
+
+    void advance(size_t run) {
+        if (runs[run]->next(heads[run])) {
+            heap.push_back(run);
+            std::push_heap(heap.begin(), heap.end(), Greater{heads});
+        } else if (runs[run]->failed()) {
+            error = true;
+        }
+    }
+
+    std::vector<Run*> runs;
+    std::vector<PostingRecord> heads;
+    std::vector<size_t> heap;
+    bool error;
+};
+
+class BatchQueue {
+public:
+    BatchQueue(size_t capacity) : capacity(capacity), done(false) {}
+
+    void push(std::vector<std::string>&& batch) {
+        std::unique_lock<std::mutex> lock(mtx);
+        notFull.wait(lock, [&] { return batches.size() < capacity; });
+        batches.push_back(std::move(batch));
+        notEmpty.notify_one();
+    }
+
+    // `seq` numbers batches in file order.
+    bool pop(std::vector<std::string>& batch, size_t& seq) {
+        std::unique_lock<std::mutex> lock(mtx);
+        notEmpty.wait(lock, [&] { return !batches.empty() || done; });
+        if (batches.empty()) return false;
+        seq = popped++;
+        batch = std::move(batches.front());
+        batches.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mtx);
+        done = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    std::mutex mtx;
+    std::condition_variable notEmpty, notFull;
+    std::deque<std::vector<std::string>> batches;
+    size_t capacity;
+    size_t popped = 0;
+    bool done;
+};
+
+struct ParsedDocument {
+    ProcessedDocument doc;
+    std::string text;
+    std::vector<float> vec;
+};
+
+// Serializes index.vec / index.docs appends and owns the docId -> length table.
+class CorpusSink {
+public:
+    CorpusSink(const std::string& outDir)
+        : vecOfs(outDir + "/index.vec", std::ios::binary),
+          docOfs(outDir + "/index.docs", std::ios::binary) {
+        // Counts are patched in finish().
+        vecOfs.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        docOfs.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    }
+
+    bool ok() const { return vecOfs.good() && docOfs.good(); }
+
+    // Writes every new document and clears `accepted[i]` for duplicate ids.
+    // Batches are taken strictly in file order, so the first occurrence of an id
+    // wins and the output files are identical for any thread count.
+    void accept(size_t seq, const std::vector<ParsedDocument>& batch, std::vector<bool>& accepted) {
+        std::unique_lock<std::mutex> lock(mtx);
+        turn.wait(lock, [&] { return seq == nextSeq; });
+        accepted.assign(batch.size(), true);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const auto& p = batch[i];
+            if (!docLengths.emplace(p.doc.id, p.doc.length).second) {
+                accepted[i] = false;
+                duplicates++;
+                continue;
+            }
+            vecOfs.write(reinterpret_cast<const char*>(&p.doc.id), sizeof(p.doc.id));
+            vecOfs.write(reinterpret_cast<const char*>(p.vec.data()), p.vec.size() * sizeof(float));
+
+            size_t len = p.text.size();
+            docOfs.write(reinterpret_cast<const char*>(&p.doc.id), sizeof(p.doc.id));
+            docOfs.write(reinterpret_cast<const char*>(&len), sizeof(len));
+            docOfs.write(p.text.c_str(), len);
+            count++;
+        }
+        nextSeq++;
+        turn.notify_all();
+    }
+
+    bool finish() {
+        vecOfs.seekp(0);
+        vecOfs.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        docOfs.seekp(0);
+        docOfs.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        vecOfs.close();
+        docOfs.close();
+        return !vecOfs.fail() && !docOfs.fail();
+    }
+
+    std::unordered_map<int, int> docLengths;
+    size_t count = 0;
+    size_t duplicates = 0;
+
+private:
+    std::mutex mtx;
+    std::condition_variable turn;
+    size_t nextSeq = 0;
+    std::ofstream vecOfs, docOfs;
+};
+
+class RunSet {
+public:
+    RunSet(const std::string& outDir) : outDir(outDir) {}
+
+    // Sorts the buffer and keeps it in memory, or spills it to disk when asked.
+    bool add(std::vector<PostingRecord>& buffer, bool spill) {
+        std::sort(buffer.begin(), buffer.end());
+        if (spill) {
+            std::string path = nextPath();
+            if (!FileRun::write(path, buffer)) return false;
+            buffer.clear();
+            std::lock_guard<std::mutex> lock(mtx);
+            spilledRuns.emplace_back(new FileRun(path));
+        } else {
+            std::unique_ptr<Run> run(new MemoryRun(std::move(buffer)));
+            buffer.clear();
+            std::lock_guard<std::mutex> lock(mtx);
+            memoryRuns.push_back(std::move(run));
+        }
+        return true;
+    }
+
+    // Merges the oldest spilled runs into intermediate runs until at most `fanIn`
+    // remain, so no merge holds more than `fanIn` run files open.
+    bool compact(size_t fanIn) {
+        while (spilledRuns.size() > fanIn) {
+            // The first pass takes only as many runs as needed to land on exactly `fanIn`.
+            size_t take = std::min(fanIn, spilledRuns.size() - fanIn + 1);
+            std::vector<std::unique_ptr<Run>> group;
+            std::vector<Run*> inputs;
+            for (size_t i = 0; i < take; ++i) {
+                group.push_back(std::move(spilledRuns.front()));
+                spilledRuns.pop_front();
+                inputs.push_back(group.back().get());
+            }
+
+            std::string path = nextPath();
+            std::ofstream ofs(path, std::ios::binary);
+            if (!ofs) {
+                Logger::log(ERROR, "Cannot create merge run " + path);
+                return false;
+            }
+            RunMerger merger(inputs);
+            PostingRecord rec;
+            while (merger.next(rec)) FileRun::writeRecord(ofs, rec);
+            ofs.close();
+            spilledRuns.emplace_back(new FileRun(path));
+            if (merger.failed() || ofs.fail()) return false;
+            merged += take;
+        }
+        return true;
+    }
+
+    std::vector<Run*> all() const {
+        std::vector<Run*> runs;
+        for (const auto& run : spilledRuns) runs.push_back(run.get());
+        for (const auto& run : memoryRuns) runs.push_back(run.get());
+        return runs;
+    }
+
+    std::deque<std::unique_ptr<Run>> spilledRuns;
+    std::vector<std::unique_ptr<Run>> memoryRuns;
+    std::atomic<int> spilled{0};
+    size_t merged = 0;
+
+private:
+    std::string nextPath() { return outDir + "/goat-run-" + std::to_string(spilled++) + ".tmp"; }
+
+    std::string outDir;
+    std::mutex mtx;
+};
+
+static void indexWorker(BatchQueue& queue, CorpusSink& sink, RunSet& runs, const IndexerConfig& config,
+                        std::atomic<size_t>& malformed, std::atomic<bool>& failed) {
+    VectorIndex embedder;
+    size_t budget = config.memBudget / config.threads;
+    std::vector<PostingRecord> buffer;
+    size_t bufferBytes = 0;
+
+    std::vector<std::string> lines;
+    std::vector<ParsedDocument> parsed;
+    std::vector<bool> accepted;
+    size_t seq;
+    while (queue.pop(lines, seq)) {
+        parsed.clear();
+        for (const auto& line : lines) {
+            try {
+                auto j = json::parse(line);
+                ParsedDocument p;
+                p.doc.id = j.at("id").get<int>();
+                p.text = j.at("text").get<std::string>();
+                tokenize(p.text, p.doc.tokens);
+                p.doc.length = p.doc.tokens.size();
+                p.vec = embedder.generateEmbedding(p.doc.tokens);
+                parsed.push_back(std::move(p));
+            } catch (const std::exception&) {
+                malformed++;
+            }
+        }
+
+        sink.accept(seq, parsed, accepted);
+
+        for (size_t i = 0; i < parsed.size(); ++i) {
+            if (!accepted[i]) continue;
+            const auto& doc = parsed[i].doc;
+            std::unordered_map<std::string, std::vector<int>> termPositions;
+            for (size_t pos = 0; pos < doc.tokens.size(); ++pos) {
+                termPositions[doc.tokens[pos]].push_back(pos);
+            }
+            for (auto& pair : termPositions) {
+                PostingRecord rec{pair.first, doc.id, (int)pair.second.size(), {}};
+                if (config.positional) BM25Index::encodePositions(pair.second, rec.positions);
+                bufferBytes += rec.footprint();
+                buffer.push_back(std::move(rec));
+            }
+
+            // Checked per document so the buffer overshoots by at most one document.
+            if (bufferBytes > budget) {
+                if (!runs.add(buffer, true)) failed = true;
+                bufferBytes = 0;
+            }
+        }
+    }
+
+    // The tail is bounded by the per-thread budget, so it always stays in memory.
+    if (!buffer.empty() && !runs.add(buffer, false)) failed = true;
+}
+
+// K-way merge of the sorted runs, streaming each completed term into the writer.
+// Returns false if any run could not be read back in full.
+static bool mergeRuns(const std::vector<Run*>& runs, BM25Writer& writer, size_t& terms) {
+    RunMerger merger(runs);
+    PostingRecord rec;
+    std::string currentTerm;
+    std::vector<std::pair<int, int>> postings;
+    PositionList termPositions;
+    terms = 0;
+
+    while (merger.next(rec)) {
+        if (rec.term != currentTerm) {
+            if (!postings.empty()) {
+                writer.addTerm(currentTerm, postings, termPositions);
+                postings.clear();
+                termPositions = PositionList();
+                terms++;
+            }
+            currentTerm = rec.term;
+        }
+        postings.push_back({rec.docId, rec.freq});
+        // Only present with --positions, where every posting has at least one.
+        if (!rec.positions.empty()) termPositions.append(rec.positions);
+    }
+    if (!postings.empty()) {
+        writer.addTerm(currentTerm, postings, termPositions);
+        terms++;
+    }
+    return !merger.failed();
+}
+
+static void printUsage() {
+    std::cerr << "Usage: goat-indexer <corpus.jsonl> [--out DIR] [--threads N] [--mem-mb MB] [--positions]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    IndexerConfig config;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--out" && i + 1 < argc) config.outDir = argv[++i];
+            else if (arg == "--threads" && i + 1 < argc) config.threads = std::max(1, std::stoi(argv[++i]));
+            else if (arg == "--mem-mb" && i + 1 < argc) config.memBudget = std::stoull(argv[++i]) * 1024 * 1024;
+            else if (arg == "--positions") config.positional = true;
+            else if (arg[0] != '-' && config.corpusPath.empty()) config.corpusPath = arg;
+            else throw std::runtime_error("bad argument " + arg);
+        }
+    } catch (const std::exception&) {
+        printUsage();
+        return 1;
+    }
+    if (config.corpusPath.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    // Leave headroom for stdio, the corpus, the output files and the run being written.
+    struct rlimit fdLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fdLimit) == 0 && fdLimit.rlim_cur != RLIM_INFINITY) {
+        size_t usable = fdLimit.rlim_cur > 18 ? fdLimit.rlim_cur - 16 : 2;
+        config.mergeFanIn = std::min(config.mergeFanIn, usable);
+    }
+
+    std::ifstream corpus(config.corpusPath);
+    if (!corpus) {
+        Logger::log(ERROR, "Cannot open corpus " + config.corpusPath);
+        return 1;
+    }
+
+    CorpusSink sink(config.outDir);
+    if (!sink.ok()) {
+        Logger::log(ERROR, "Cannot write to output directory " + config.outDir);
+        return 1;
+    }
+
+    Logger::log(INFO, "Indexing " + config.corpusPath + " with " + std::to_string(config.threads) + " threads");
+    auto start = std::chrono::steady_clock::now();
+
+    BatchQueue queue(config.threads * 2);
+    RunSet runs(config.outDir);
+    std::atomic<size_t> malformed(0);
+    std::atomic<bool> failed(false);
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < config.threads; ++i) {
+        workers.emplace_back(indexWorker, std::ref(queue), std::ref(sink), std::ref(runs),
+                             std::cref(config), std::ref(malformed), std::ref(failed));
+    }
+
+    std::vector<std::string> batch;
+    std::string line;
+    while (std::getline(corpus, line)) {
+        if (line.empty()) continue;
+        batch.push_back(std::move(line));
+        if (batch.size() >= config.batchSize) {
+            queue.push(std::move(batch));
+            batch = {};
+        }
+    }
+    if (!batch.empty()) queue.push(std::move(batch));
+    queue.close();
+    for (auto& t : workers) t.join();
+
+    if (failed || !sink.finish()) {
+        Logger::log(ERROR, "Failed writing index files");
+        return 1;
+    }
+    Logger::log(INFO, "Processed " + std::to_string(sink.count) + " documents (" +
+                      std::to_string(sink.duplicates) + " duplicate ids, " +
+                      std::to_string(malformed.load()) + " malformed lines, " +
+                      std::to_string(runs.spilled.load()) + " runs spilled to disk)");
+
+    if (!runs.compact(config.mergeFanIn)) {
+        Logger::log(ERROR, "Failed merging spilled runs");
+        return 1;
+    }
+    if (runs.merged > 0) {
+        Logger::log(INFO, "Merged " + std::to_string(runs.merged) + " spilled runs in groups of up to " +
+                          std::to_string(config.mergeFanIn));
+    }
+
+    BM25Writer writer(config.outDir + "/index.bm25", sink.docLengths, config.positional);
+    if (!writer.ok()) {
+        Logger::log(ERROR, "Cannot write index.bm25");
+        return 1;
+    }
+    size_t terms;
+    if (!mergeRuns(runs.all(), writer, terms)) {
+        Logger::log(ERROR, "Failed reading spilled runs");
+        return 1;
+    }
+    if (!writer.close()) {
+        Logger::log(ERROR, "Failed writing index.bm25");
+        return 1;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / 1000.0;
+    Logger::log(INFO, "Wrote " + std::to_string(terms) + " terms to " + config.outDir + " in " +
+                      std::to_string(seconds) + " s");
+    return 0;
+}
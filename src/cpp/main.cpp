@@ -1,43 +1,51 @@
 #include "HybridSearcher.h"
+#include "BackgroundSaver.h"
+#include "Scheduler.h"
 #include "json.hpp"
 #include "Logger.h"
 #include <iostream>
 #include <string>
-#include <thread>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <shared_mutex>
+#include <memory>
+#include <deque>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdlib>
+#include <sys/time.h>
 
 using json = nlohmann::json;
 
 HybridSearcher searcher;
-std::mutex searcher_mutex;
+std::shared_mutex searcher_mutex;
+BackgroundSaver saver;
+std::unique_ptr<Scheduler> scheduler;
 
-void handle_connection(int client_socket) {
-    char buffer[8192] = {0};
-    ssize_t bytesRead = read(client_socket, buffer, 8192);
+// Accepted sockets waiting for a reader thread; the acceptor only queues them.
+std::mutex pending_mutex;
+std::condition_variable pending_ready;
+std::deque<int> pending_sockets;
 
-    if (bytesRead <= 0) {
-        close(client_socket);
-        return;
-    }
-
-    std::string command_str(buffer);
-
-    std::string log_preview = command_str.length() > 60 ? command_str.substr(0, 60) + "..." : command_str;
-    std::replace(log_preview.begin(), log_preview.end(), '\n', ' ');
-    Logger::log(NET, "Received Payload (" + std::to_string(bytesRead) + " bytes): " + log_preview);
+std::string execute(Job& job) {
+    const std::string& command = job.command;
+    const std::string& payload = job.payload;
 
     std::string response;
     try {
-        size_t first_space = command_str.find(' ');
-        if (first_space == std::string::npos) throw std::runtime_error("Invalid Protocol Format");
+        // Searches share the index; only INDEX and SAVE are exclusive.
+        // SAVE_STATUS and STATS must answer while a writer holds the searcher.
+        std::shared_lock<std::shared_mutex> readLock(searcher_mutex, std::defer_lock);
+        std::unique_lock<std::shared_mutex> lock(searcher_mutex, std::defer_lock);
+        if (command == "SEARCH") readLock.lock();
+        else if (command == "INDEX" || command == "SAVE") lock.lock();
 
-        std::string command = command_str.substr(0, first_space);
-        std::string payload = command_str.substr(first_space + 1);
-
-        std::lock_guard<std::mutex> lock(searcher_mutex);
+        if (job.expired()) {
+            job.timedOut = true;
+            return "{\"error\":\"deadline exceeded\"}";
+        }
 
         if (command == "INDEX") {
             ScopedTimer t("Indexing Document");
@@ -53,15 +61,45 @@ void handle_connection(int client_socket) {
             std::string query = j["query"];
             Logger::log(INFO, "Processing Query: \"" + query + "\"");
 
-            auto results = searcher.search(query, 50);
-            response = json(results).dump();
+            bool explain = j.value("explain", false);
+
+            QueryProfile profile;
+            auto results = searcher.search(query, 50, &profile);
+            if (explain) {
+                response = "{\"results\":" + json(results).dump() +
+                           ",\"explain\":" + Telemetry::instance().explain(profile) + "}";
+            } else {
+                response = json(results).dump();
+            }
             Logger::log(INFO, "Returning " + std::to_string(results.size()) + " results.");
 
         } else if (command == "SAVE") {
+            auto j = json::parse(payload, nullptr, false);
+            bool wait = j.is_object() && j.value("wait", false);
+
             Logger::log(INFO, "Saving Index to disk...");
-            searcher.save("index.bm25", "index.vec");
-            response = "{\"status\":\"saved\"}";
-            Logger::log(INFO, "Index Saved Successfully.");
+            auto started = saver.start(searcher, "index.bm25", "index.vec");
+            if (started == BackgroundSaver::ALREADY_RUNNING) {
+                response = "{\"status\":\"in_progress\"}";
+            } else if (started == BackgroundSaver::FAILED) {
+                Logger::log(WARN, "Falling back to foreground save");
+                bool ok = searcher.save("index.bm25", "index.vec");
+                response = ok ? "{\"status\":\"saved\"}" : "{\"error\":\"save failed\"}";
+            } else if (wait) {
+                // Reply once the child exits, without holding the writer slot meanwhile.
+                int client_socket = job.socket;
+                std::thread([client_socket] {
+                    sendResponse(client_socket, saver.wait() ? "{\"status\":\"saved\"}" : "{\"error\":\"save failed\"}");
+                }).detach();
+            } else {
+                response = "{\"status\":\"started\"}";
+            }
+
+        } else if (command == "SAVE_STATUS") {
+            response = saver.status();
+
+        } else if (command == "STATS") {
+            response = scheduler->stats();
 
         } else {
             Logger::log(WARN, "Unknown Command Received: " + command);
@@ -72,11 +110,78 @@ void handle_connection(int client_socket) {
         response = std::string("{\"error\":\"") + e.what() + "\"}";
     }
 
-    send(client_socket, response.c_str(), response.length(), 0);
-    close(client_socket);
+    return response;
 }
 
-void start_server(int port) {
+void handle_connection(int client_socket) {
+    char buffer[8192] = {0};
+    ssize_t bytesRead = read(client_socket, buffer, 8192);
+
+    if (bytesRead <= 0) {
+        close(client_socket);
+        return;
+    }
+
+    std::string command_str(buffer);
+
+    std::string log_preview = command_str.length() > 60 ? command_str.substr(0, 60) + "..." : command_str;
+    std::replace(log_preview.begin(), log_preview.end(), '\n', ' ');
+    Logger::log(NET, "Received Payload (" + std::to_string(bytesRead) + " bytes): " + log_preview);
+
+    size_t first_space = command_str.find(' ');
+    if (first_space == std::string::npos) {
+        Logger::log(ERROR, "Exception handling request: Invalid Protocol Format");
+        sendResponse(client_socket, "{\"error\":\"Invalid Protocol Format\"}");
+        return;
+    }
+
+    Job job;
+    job.socket = client_socket;
+    job.command = command_str.substr(0, first_space);
+    job.payload = command_str.substr(first_space + 1);
+
+    if (job.command != "SEARCH" && job.command != "INDEX" && job.command != "SAVE" &&
+        job.command != "SAVE_STATUS" && job.command != "STATS") {
+        Logger::log(WARN, "Unknown Command Received: " + job.command);
+        sendResponse(client_socket, "{\"error\":\"unknown command\"}");
+        return;
+    }
+
+    // Optional client budget, e.g. SEARCH {"query": "...", "deadline_ms": 200}
+    auto j = json::parse(job.payload, nullptr, false);
+    if (j.is_object() && j.contains("deadline_ms") && j["deadline_ms"].is_number()) {
+        job.hasDeadline = true;
+        job.deadline = SchedulerClock::now() + std::chrono::microseconds((long long)(j["deadline_ms"].get<double>() * 1000));
+    }
+
+    if (job.command == "SEARCH" || job.command == "INDEX" || job.command == "SAVE") {
+        Scheduler::Lane lane = job.command == "SEARCH" ? Scheduler::READ : Scheduler::WRITE;
+        std::string rejection;
+        if (!scheduler->submit(std::move(job), lane, rejection)) {
+            Logger::log(WARN, "Shedding request: " + rejection);
+            sendResponse(client_socket, rejection);
+        }
+        return;
+    }
+
+    // Status commands never touch the queues or the exclusive lock.
+    sendResponse(client_socket, execute(job));
+}
+
+void reader_loop() {
+    while (true) {
+        int client_socket;
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex);
+            pending_ready.wait(lock, [] { return !pending_sockets.empty(); });
+            client_socket = pending_sockets.front();
+            pending_sockets.pop_front();
+        }
+        handle_connection(client_socket);
+    }
+}
+
+void start_server(int port, int readers) {
     int server_fd;
     struct sockaddr_in address;
     int opt = 1;
@@ -93,10 +198,12 @@ void start_server(int port) {
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
         perror("bind failed"); exit(EXIT_FAILURE);
     }
-    if (listen(server_fd, 10) < 0) {
+    if (listen(server_fd, SOMAXCONN) < 0) {
         perror("listen"); exit(EXIT_FAILURE);
     }
 
+    for (int i = 0; i < readers; ++i) std::thread(reader_loop).detach();
+
     Logger::log(INFO, "GOAT SEARCH ENGINE STARTED");
     Logger::log(NET, "Daemon listening on port " + std::to_string(port) + "...");
 
@@ -106,17 +213,56 @@ void start_server(int port) {
             Logger::log(ERROR, "Socket Accept Failed");
             continue;
         }
-        std::thread(handle_connection, client_socket).detach();
+        // A stalled client can hold one reader for at most a second, never the acceptor.
+        struct timeval timeout = {1, 0};
+        setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::unique_lock<std::mutex> lock(pending_mutex);
+        if (pending_sockets.size() >= SOMAXCONN) {
+            lock.unlock();
+            Logger::log(WARN, "Shedding connection: all readers busy");
+            sendResponse(client_socket, "{\"error\":\"overloaded\",\"lane\":\"accept\"}");
+            continue;
+        }
+        pending_sockets.push_back(client_socket);
+        lock.unlock();
+        pending_ready.notify_one();
     }
 }
 
 int main() {
     Logger::log(INFO, "Booting System...");
+
+    const char* slowMs = std::getenv("GOAT_SLOW_QUERY_MS");
+    const char* slowSample = std::getenv("GOAT_SLOW_QUERY_SAMPLE");
+    Telemetry::instance().configureSlowLog(
+        slowMs ? std::atof(slowMs) : 100.0,
+        slowSample ? std::atoi(slowSample) : 1,
+        "slow_queries.log"
+    );
+
+    const char* positions = std::getenv("GOAT_POSITIONS");
+    searcher.setPositional(positions && std::string(positions) == "1");
+
+    const char* fuzzyDistance = std::getenv("GOAT_FUZZY_DISTANCE");
+    searcher.setFuzzyDistance(fuzzyDistance ? std::atoi(fuzzyDistance) : 2);
+
     if (!searcher.load("index.bm25", "index.vec")) {
         Logger::log(WARN, "No existing index found. Starting Fresh.");
     } else {
         Logger::log(INFO, "Indexes loaded from disk successfully.");
     }
-    start_server(9999);
+
+    SchedulerConfig schedulerConfig;
+    if (const char* v = std::getenv("GOAT_SEARCH_WORKERS")) schedulerConfig.readWorkers = std::max(1, std::atoi(v));
+    if (const char* v = std::getenv("GOAT_SEARCH_QUEUE")) schedulerConfig.readCapacity = std::max(1, std::atoi(v));
+    if (const char* v = std::getenv("GOAT_WRITE_QUEUE")) schedulerConfig.writeCapacity = std::max(1, std::atoi(v));
+    if (const char* v = std::getenv("GOAT_WRITE_DEFER_MS")) schedulerConfig.maxWriteDefer = std::chrono::milliseconds(std::atoi(v));
+    scheduler.reset(new Scheduler(execute, schedulerConfig));
+    scheduler->start();
+    Logger::log(INFO, "Scheduler started with " + std::to_string(schedulerConfig.readWorkers) + " search workers");
+
+    const char* readers = std::getenv("GOAT_READER_THREADS");
+    start_server(9999, readers ? std::max(1, std::atoi(readers)) : 4);
     return 0;
 }